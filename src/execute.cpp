@@ -3,11 +3,19 @@
     Copyright (C) 2025 Ivan Klikovac
     This program is free software. */
 
+#include <cos/query-cache.h>
 #include <cos/cos.h>
+#include <engine.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <set>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "basic-block.h"
 #include "gcc-plugin.h"
 #include "plugin-version.h"
@@ -16,6 +24,10 @@
 #include "tree.h"
 #include "gimple.h"
 #include "gimple-iterator.h"
+#include "dominance.h"
+#include "tree-cfg.h"
+#include "tree-dfa.h"
+#include "ssa-iterators.h"
 #include "context.h"
 #include "diagnostic.h"
 #include "tree-pass.h"
@@ -31,6 +43,326 @@ std::unordered_map<basic_block, state> states = {};
 // States that are yet unexplored.
 std::vector<state> pending_states;
 
+// The other side of a branch that the inputs decided, along with the inputs
+// of the run that didn't take it.
+struct flip
+{
+    inner pc;
+    std::map<unsigned int, concrete> inputs;
+};
+
+// Branches to flip in later concolic runs. Finding inputs that satisfy their
+// path conditions yields the inputs for the next run.
+std::vector<flip> pending_inputs;
+
+// The path conditions that have been queued up in pending_inputs, by
+// query_cache::key, so that a prefix shared by several runs is flipped once.
+std::set<uint64_t> flipped;
+
+// In concolic mode every state carries a concrete assignment, and branches
+// whose outcome it decides are followed without forking. The other side of
+// those that depend on the inputs is covered by later runs with new inputs.
+bool concolic_mode = false;
+
+// Blocks that have been handed a state and are yet to be analyzed in a
+// concolic run. Blocks the run doesn't reach never end up in here.
+std::vector<basic_block> worklist;
+
+// Limits on the concolic runs of one function. Loops whose condition isn't
+// concretely known fork on every iteration, so a block is only analyzed so
+// many times per run.
+constexpr int concolic_max_steps = 1024;
+constexpr int concolic_max_visits = 8;
+constexpr int concolic_max_runs = 32;
+constexpr size_t concolic_max_flips = 256;
+
+// How many input assignments are tried when looking for the inputs of a run.
+constexpr int concolic_max_tries = 2048;
+
+// The concrete inputs of the current run, by the SSA version of the parameter's
+// default definition. Parameters that aren't in here start out as zero.
+std::map<unsigned int, concrete> concolic_inputs;
+
+// The types of the parameters of current_fn, by the SSA version of their
+// default definition.
+std::map<unsigned int, tree> input_params;
+
+// Where analyze_fn dumps the states, stdout unless set_dump says otherwise.
+writer state_dump{STDOUT_FILENO, writer::HUMAN, true};
+
+// Dump states into the file at `path`, as JSON lines if `json` is set.
+// The file is appended to, since every compiler process writes its own part.
+void set_dump(const char* path, bool json)
+{
+    int fd = STDOUT_FILENO;
+
+    if(path && (fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        fprintf(stderr, "can't open %s, dumping to stdout\n", path);
+        fd = STDOUT_FILENO;
+    }
+
+    state_dump.reset(fd, json ? writer::JSON : writer::HUMAN);
+}
+
+// The blocks control dependent on each block, from the post-dominator tree.
+std::unordered_map<basic_block, std::vector<basic_block>> control_deps;
+
+// Blocks whose gcond doesn't need to go into the path condition, since the
+// branches reconverge without anything observable happening on either of
+// them and the condition's operands aren't used after that.
+std::set<basic_block> irrelevant_guards;
+
+// The blocks that some edge from a block they dominate leads back into.
+std::set<basic_block> loop_headers;
+
+// A block depends on the edge (bb, succ) if it's on the post-dominator tree
+// path from succ up to, but not including, the immediate post-dominator of bb.
+void compute_control_deps()
+{
+    control_deps.clear();
+
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, current_fn) {
+        basic_block ipdom = get_immediate_dominator(CDI_POST_DOMINATORS, bb);
+        auto& deps = control_deps[bb];
+
+        edge e;
+        edge_iterator ei;
+        FOR_EACH_EDGE(e, ei, bb->succs) {
+            for(basic_block runner = e->dest; runner && runner != ipdom;
+                runner = get_immediate_dominator(CDI_POST_DOMINATORS, runner)) {
+                if(runner == EXIT_BLOCK_PTR_FOR_FN(current_fn)) break;
+                if(std::find(deps.begin(), deps.end(), runner) == deps.end()) deps.push_back(runner);
+            }
+        }
+    }
+}
+
+// Whether every real use of the SSA name is inside region.
+bool uses_stay_in(tree name, const std::set<basic_block>& region)
+{
+    use_operand_p use_p;
+    imm_use_iterator iter;
+    FOR_EACH_IMM_USE_FAST(use_p, iter, name) {
+        gimple* use = USE_STMT(use_p);
+        if(is_gimple_debug(use)) continue;
+        if(!region.count(gimple_bb(use))) return false;
+    }
+
+    return true;
+}
+
+bool guard_is_irrelevant(basic_block bb, gcond* cond)
+{
+    basic_block join = get_immediate_dominator(CDI_POST_DOMINATORS, bb);
+    if(!join || join == EXIT_BLOCK_PTR_FOR_FN(current_fn)) return false;
+
+    // the branch picks which values flow into the join
+    if(!gimple_seq_empty_p(phi_nodes(join))) return false;
+
+    // everything the guard decides on, directly or through nested guards
+    std::set<basic_block> region = {bb};
+    std::vector<basic_block> todo = {bb};
+
+    while(!todo.empty()) {
+        basic_block cur = todo.back();
+        todo.pop_back();
+
+        // A loop anywhere in the region may not terminate, so dropping the
+        // guard could change whether the join is reached at all. A block that
+        // decides whether it runs again is a loop's exit test, and a loop
+        // without an exit still has a header.
+        const auto& deps = control_deps[cur];
+        if(loop_headers.count(cur) || std::find(deps.begin(), deps.end(), cur) != deps.end()) return false;
+
+        for(basic_block dep: deps) {
+            if(region.insert(dep).second) todo.push_back(dep);
+        }
+    }
+
+    for(basic_block dep: region) {
+        // the statements before the gcond run either way
+        if(dep == bb) continue;
+
+        // a trap that only happens under the guard is just as observable
+        // as a store
+        gimple_stmt_iterator gsi;
+        for(gsi = gsi_start_bb(dep); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gimple* stmt = gsi_stmt(gsi);
+            if(gimple_has_side_effects(stmt) || gimple_vdef(stmt) || gimple_could_trap_p(stmt)) return false;
+
+            tree lhs = gimple_get_lhs(stmt);
+            if(lhs && TREE_CODE(lhs) == SSA_NAME && !uses_stay_in(lhs, region)) return false;
+        }
+
+        gphi_iterator psi;
+        for(psi = gsi_start_phis(dep); !gsi_end_p(psi); gsi_next(&psi)) {
+            if(!uses_stay_in(gimple_phi_result(psi.phi()), region)) return false;
+        }
+    }
+
+    // the condition's symbols have to be dead past the join
+    for(tree op: {gimple_cond_lhs(cond), gimple_cond_rhs(cond)}) {
+        if(TREE_CODE(op) == SSA_NAME && !uses_stay_in(op, region)) return false;
+    }
+
+    return true;
+}
+
+// Find the guards that can be left out, before any of the blocks are analyzed.
+// Like the rest of GCC's dominance code, this expects cfun to be current_fn.
+void find_irrelevant_guards()
+{
+    bool had_postdom = dom_info_available_p(CDI_POST_DOMINATORS);
+    if(!had_postdom) calculate_dominance_info(CDI_POST_DOMINATORS);
+
+    bool had_dom = dom_info_available_p(CDI_DOMINATORS);
+    if(!had_dom) calculate_dominance_info(CDI_DOMINATORS);
+
+    compute_control_deps();
+    irrelevant_guards.clear();
+    loop_headers.clear();
+
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, current_fn) {
+        edge e;
+        edge_iterator ei;
+        FOR_EACH_EDGE(e, ei, bb->preds) {
+            if(dominated_by_p(CDI_DOMINATORS, e->src, bb)) loop_headers.insert(bb);
+        }
+    }
+
+    FOR_EACH_BB_FN(bb, current_fn) {
+        gimple* last = *gsi_last_bb(bb);
+        if(!last || gimple_code(last) != GIMPLE_COND) continue;
+
+        if(guard_is_irrelevant(bb, as_a<gcond*>(last))) irrelevant_guards.insert(bb);
+    }
+
+    if(!had_postdom) free_dominance_info(CDI_POST_DOMINATORS);
+    if(!had_dom) free_dominance_info(CDI_DOMINATORS);
+}
+
+// Query results shared with other compiler processes, see set_query_cache.
+query_cache shared_cache;
+
+// How many input searches the current function needed, and how many of them
+// the cache answered.
+long searches = 0, cache_hits = 0;
+
+// Share query results through the cache file at `path`. A new file gets room
+// for `slots` entries.
+void set_query_cache(const char* path, size_t slots)
+{
+    if(!slots) fprintf(stderr, "query cache %s needs room for at least one entry\n", path);
+    else if(!shared_cache.open(path, slots)) fprintf(stderr, "can't open query cache %s\n", path);
+}
+
+// Where analyze_fn records per-function measurements, see set_capture.
+writer capture{-1, writer::JSON};
+
+// Append a line with measurements for every analyzed function to the file at
+// `path`, for symexec-bench to compare against a baseline.
+void set_capture(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) fprintf(stderr, "can't open capture file %s\n", path);
+    else capture.reset(fd, writer::JSON);
+}
+
+// /proc/self/statm, kept open so that a sample is a single pread.
+int statm_fd = -1;
+
+long current_rss_kb()
+{
+    static const long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    char buf[128];
+
+    if(statm_fd < 0) statm_fd = open("/proc/self/statm", O_RDONLY);
+
+    ssize_t n = statm_fd < 0 ? -1 : pread(statm_fd, buf, sizeof(buf) - 1, 0);
+    if(n <= 0) return 0;
+    buf[n] = 0;
+
+    // the total size comes first, then the resident set
+    char* p;
+    strtol(buf, &p, 10);
+    return strtol(p, nullptr, 10) * page_kb;
+}
+
+// The highest resident set size seen while analyzing the current function.
+// ru_maxrss would be no good here, it's a high-water mark for the whole
+// process, so every function after the biggest one would show no growth.
+long rss_peak_kb = 0;
+
+// The time spent in sample_rss, which analyze_fn leaves out of the engine's.
+std::chrono::steady_clock::duration rss_sampling_time{};
+
+// Sampled after every block when capturing.
+void sample_rss()
+{
+    if(!capture.to_file()) return;
+
+    auto start = std::chrono::steady_clock::now();
+    rss_peak_kb = std::max(rss_peak_kb, current_rss_kb());
+    rss_sampling_time += std::chrono::steady_clock::now() - start;
+}
+
+// Identifies the function body, so that a capture is only compared against
+// one of the same code. Only the shape of the GIMPLE goes into it.
+size_t body_hash(long& bb_count, long& stmt_count)
+{
+    size_t h = 0;
+    bb_count = stmt_count = 0;
+
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, current_fn) {
+        h = mix_hash(h + bb->index);
+        bb_count++;
+
+        gimple_stmt_iterator gsi;
+        for(gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gimple* stmt = gsi_stmt(gsi);
+            h = mix_hash(h + gimple_code(stmt));
+            if(is_gimple_assign(stmt)) h = mix_hash(h + gimple_assign_rhs_code(stmt));
+            stmt_count++;
+        }
+    }
+
+    return h;
+}
+
+void record_capture(std::chrono::steady_clock::duration elapsed, long peak_rss)
+{
+    long bb_count, stmt_count;
+    size_t hash = body_hash(bb_count, stmt_count);
+
+    long disjuncts = 0, terms = 0;
+    for(const auto& pair: states) {
+        disjuncts += pair.second.pc.ors.size();
+        for(const auto& inner: pair.second.pc.ors) terms += inner.ands.size();
+    }
+
+    char hex[20];
+    snprintf(hex, sizeof(hex), "%016zx", hash);
+
+    writer& w = capture;
+    w.put("{\"fn\":").put_quoted(function_name(current_fn))
+        .put(",\"hash\":\"").put(hex)
+        .put("\",\"bbs\":").put(bb_count)
+        .put(",\"stmts\":").put(stmt_count)
+        .put(",\"time_us\":").put((long) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count())
+        .put(",\"peak_rss_kb\":").put(peak_rss)
+        .put(",\"states\":").put((long) states.size())
+        .put(",\"pending\":").put((long) (pending_states.size() + pending_inputs.size()))
+        .put(",\"disjuncts\":").put(disjuncts)
+        .put(",\"terms\":").put(terms)
+        .put(",\"searches\":").put(searches)
+        .put(",\"cache_hits\":").put(cache_hits)
+        .put("}\n");
+    w.flush();
+}
+
 void add_branch(const state& s1, const state& s2)
 {
     // feed into the engine
@@ -84,6 +416,76 @@ std::set<symbolic> find_dependencies(symbolic& sym, state& s)
     return deps;
 }
 
+// Find the concrete value of the operand `t` in `s`, if it has one.
+bool concrete_value(tree t, state& s, concolic_value& out)
+{
+    // REAL_CSTs aren't read by term::from_tree yet
+    if(TREE_CODE(t) == INTEGER_CST) {
+        long l;
+        if(!wrap_to_type(TREE_INT_CST_LOW(t), TREE_TYPE(t), l)) return false;
+
+        out = {concrete{l}, false};
+        return true;
+    }
+
+    if(TREE_CODE(t) != SSA_NAME) return false;
+
+    symbolic sym(t);
+
+    auto it = s.env.find(sym);
+    if(it != s.env.end()) {
+        out = it->second;
+        return out.known;
+    }
+
+    // function inputs get their value from the current run
+    if(!SSA_NAME_IS_DEFAULT_DEF(t) || !SSA_NAME_VAR(t)
+    || TREE_CODE(SSA_NAME_VAR(t)) != PARM_DECL) return false;
+
+    auto input = concolic_inputs.find(sym.version);
+    if(input != concolic_inputs.end()) out = {input->second, true};
+    else if(FLOAT_TYPE_P(TREE_TYPE(t))) out = {concrete{0.0}, true};
+    else out = {concrete{0L}, true};
+
+    s.env[sym] = out;
+    return true;
+}
+
+// Evaluate the right hand side of an assignment concretely and bind it to lhs.
+// Copies and conversions between integral types are the only unary operations
+// that can be evaluated.
+void concrete_assign(tree lhs, tree_code op, tree rhs1, tree rhs2, state& s)
+{
+    symbolic sym(lhs);
+    concolic_value a{}, b{};
+
+    bool known = concrete_value(rhs1, s, a);
+    concrete result = a.val;
+
+    if(rhs2) known = concrete_value(rhs2, s, b) && known && eval_binop(op, a.val, b.val, TREE_TYPE(lhs), result);
+    else if(CONVERT_EXPR_CODE_P(op)) {
+        long l;
+        known = known && INTEGRAL_TYPE_P(TREE_TYPE(lhs)) && std::holds_alternative<long>(a.val)
+            && wrap_to_type(std::get<long>(a.val), TREE_TYPE(lhs), l);
+        if(known) result = l;
+    }
+    else if(op != SSA_NAME && op != INTEGER_CST && op != REAL_CST) known = false;
+
+    bool from_input = a.from_input || b.from_input;
+
+    if(known || from_input) s.env[sym] = {result, from_input, known};
+    else s.env.erase(sym);
+}
+
+// Anything the run knows about the inputs, it stops knowing. For paths that
+// the concrete run doesn't take, where its values may not hold.
+void forget_inputs(state& s)
+{
+    for(auto& pair: s.env) {
+        if(pair.second.from_input) pair.second.known = false;
+    }
+}
+
 void process_arithmetic(tree lhs, tree_code op, tree rhs1, tree rhs2, state& new_state)
 {
     value lhs_val(lhs);
@@ -116,7 +518,6 @@ void process_arithmetic(tree lhs, tree_code op, tree rhs1, tree rhs2, state& new
         case MULT_EXPR: {
             // lhs = rhs1 * rhs2
             expr* prod = new expr(rhs1_val, MULT_EXPR, rhs2_val);
-            printf("allocated %p\n", prod);
             term eq_term = {lhs_val, EQ_EXPR, prod};
             new_state.add_constraint(eq_term);
         }
@@ -143,6 +544,7 @@ void process_assign(gassign* assign, state& s)
             term eq_term(lhs_val, EQ_EXPR, rhs_val);
             s.add_constraint(eq_term);
 
+            if(concolic_mode) concrete_assign(lhs, op, rhs, NULL_TREE, s);
             break;
         }
 
@@ -153,6 +555,8 @@ void process_assign(gassign* assign, state& s)
             value rhs_val(rhs);
             term eq_term(lhs_val, EQ_EXPR, rhs_val);
             s.add_constraint(eq_term);
+
+            if(concolic_mode) concrete_assign(lhs, op, rhs, NULL_TREE, s);
             break;
         }
 
@@ -162,36 +566,92 @@ void process_assign(gassign* assign, state& s)
             tree rhs1 = gimple_assign_rhs1(assign);
             tree rhs2 = gimple_assign_rhs2(assign);
             process_arithmetic(lhs, op, rhs1, rhs2, s);
+
+            if(concolic_mode) concrete_assign(lhs, op, rhs1, rhs2, s);
             break;
         }
 
-        default: break;
+        default:
+            // not modelled symbolically, the concrete side still has to know
+            // whether the result depends on the inputs
+            if(concolic_mode) {
+                tree rhs2 = gimple_num_ops(assign) > 2 ? gimple_assign_rhs2(assign) : NULL_TREE;
+                concrete_assign(lhs, op, gimple_assign_rhs1(assign), rhs2, s);
+            }
+            break;
     }
 }
 
+// Make s the state at the start of `to`, and queue it up in concolic runs.
+void hand_over(basic_block to, const state& s)
+{
+    if(to == EXIT_BLOCK_PTR_FOR_FN(current_fn)) return;
+
+    states[to] = s;
+    if(concolic_mode) worklist.push_back(to);
+}
+
+// Queue up the path condition pc with the branch t taken the other way, for a
+// later run to cover.
+void add_flip(const outer& pc, term t)
+{
+    for(const auto& in: pc.ors) {
+        if(pending_inputs.size() >= concolic_max_flips) return;
+
+        // the path already goes that way
+        inner other = in;
+        if(!other.add_constraint(t)) continue;
+
+        if(flipped.insert(query_cache::key(other)).second)
+            pending_inputs.push_back({std::move(other), concolic_inputs});
+    }
+}
+
+// The block that a switch on a concretely known index goes to, or null if the
+// index isn't known.
+basic_block switch_target(gswitch* sw, state& s, concolic_value& index)
+{
+    tree idx = gimple_switch_index(sw);
+    if(!concrete_value(idx, s, index) || !std::holds_alternative<long>(index.val)) return nullptr;
+
+    tree type = TREE_TYPE(idx);
+
+    // label 0 is the default one
+    for(unsigned int i = 1; i < gimple_switch_num_labels(sw); i++) {
+        tree label = gimple_switch_label(sw, i);
+        tree high = CASE_HIGH(label) ? CASE_HIGH(label) : CASE_LOW(label);
+
+        long lo, hi;
+        bool above, below;
+        if(!wrap_to_type(TREE_INT_CST_LOW(CASE_LOW(label)), type, lo)
+        || !wrap_to_type(TREE_INT_CST_LOW(high), type, hi)) return nullptr;
+
+        eval_cond(GE_EXPR, index.val, concrete{lo}, above, TYPE_UNSIGNED(type));
+        eval_cond(LE_EXPR, index.val, concrete{hi}, below, TYPE_UNSIGNED(type));
+        if(above && below) return label_to_block(current_fn, CASE_LABEL(label));
+    }
+
+    return label_to_block(current_fn, CASE_LABEL(gimple_switch_default_label(sw)));
+}
+
+// Constants become concrete values, anything else is taken for a symbol.
+value cond_operand(tree t)
+{
+    if(TREE_CODE(t) == INTEGER_CST || TREE_CODE(t) == REAL_CST) return term::from_tree(t);
+    return value(t);
+}
+
 void process_cond(gcond* cond, basic_block bb, state& s)
 {
     tree lhs = gimple_cond_lhs(cond);
     tree rhs = gimple_cond_rhs(cond);
     tree_code op = gimple_cond_code(cond);
 
-    term condition(lhs, op, rhs);
+    term condition(cond_operand(lhs), op, cond_operand(rhs));
 
     // leaving this basic block, update its state
     states[bb] = s;
 
-    // todo: add satisfiability checks and only branch if unknown
-    
-    // branch into two states
-    // one if the condition is true (the same state can be reused), // can it?
-    // and one it it's false
-    
-    state if_true = s;
-    state if_false = s;
-
-    if_true.add_constraint(condition);
-    if_false.add_constraint(!condition);
-
     // now go through the cfg to find which bbs to branch into
     // the branches from the gcond are in this block's successors
 
@@ -205,11 +665,63 @@ void process_cond(gcond* cond, basic_block bb, state& s)
         if(e->flags & EDGE_FALSE_VALUE) bb_if_false = e->dest;
     }
 
-    if(bb_if_true) states[bb_if_true] = if_true;
-    if(bb_if_false) states[bb_if_false] = if_false;
+    bool irrelevant = irrelevant_guards.count(bb);
+
+    concolic_value a{}, b{};
+    bool taken;
+
+    bool known_lhs = concolic_mode && concrete_value(lhs, s, a);
+    bool known_rhs = concolic_mode && concrete_value(rhs, s, b);
+
+    if(known_lhs && known_rhs && eval_cond(op, a.val, b.val, taken, TYPE_UNSIGNED(TREE_TYPE(lhs)))) {
+        // the concrete run decides the branch, so only follow that one
+        state followed = s;
+        if(!irrelevant) followed.add_constraint(taken ? condition : !condition);
+
+        basic_block bb_followed = taken ? bb_if_true : bb_if_false;
+        if(bb_followed) hand_over(bb_followed, followed);
+
+        // a branch decided by constants alone can never flip, otherwise a
+        // later run takes the other side
+        if(!irrelevant && (a.from_input || b.from_input)) add_flip(s.pc, taken ? !condition : condition);
+        return;
+    }
+
+    // the inputs decide this branch, but the concrete run can't tell how, so
+    // what it knows about them may not hold on either side
+    state followed = s;
+    if((!known_lhs && a.from_input) || (!known_rhs && b.from_input)) forget_inputs(followed);
+
+    if(irrelevant) {
+        // both sides end up in the same place, so there's nothing to fork on
+        if(bb_if_true) hand_over(bb_if_true, followed);
+        if(bb_if_false) hand_over(bb_if_false, followed);
+
+        if(!concolic_mode) pending_states.push_back(followed);
+        sched();
+        return;
+    }
+
+    // todo: add satisfiability checks and only branch if unknown
+    
+    // branch into two states
+    // one if the condition is true (the same state can be reused), // can it?
+    // and one it it's false
+    
+    state if_true = followed;
+    state if_false = std::move(followed);
+
+    if_true.add_constraint(condition);
+    if_false.add_constraint(!condition);
+
+    if(bb_if_true) hand_over(bb_if_true, if_true);
+    if(bb_if_false) hand_over(bb_if_false, if_false);
+
+    // concolic runs keep their states in the worklist
+    if(concolic_mode) return;
 
-    pending_states.push_back(if_true);
-    pending_states.push_back(if_false);
+    pending_states.push_back(std::move(if_true));
+    pending_states.push_back(std::move(if_false));
     sched();
 }
 
@@ -226,7 +738,9 @@ void analyze_bb(basic_block bb)
 {
     if(bb == EXIT_BLOCK_PTR_FOR_FN(current_fn) || bb == ENTRY_BLOCK_PTR_FOR_FN(current_fn)) return;
 
+    // concolic runs carry the concrete assignment over from the predecessor
     state s;
+    if(concolic_mode && states.count(bb)) s = states[bb];
 
     gimple_stmt_iterator gsi;
     for(gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
@@ -235,18 +749,306 @@ void analyze_bb(basic_block bb)
     }
 
     //states[bb] = s;
+
+    // a gcond hands the state over itself, anything else continues into
+    // its successors
+    gimple* last = *gsi_last_bb(bb);
+    if(!concolic_mode || (last && gimple_code(last) == GIMPLE_COND)) return;
+
+    // a switch on a known index goes one way, the other cases are covered
+    // by runs with other inputs
+    concolic_value index{};
+    basic_block target = nullptr;
+    if(last && gimple_code(last) == GIMPLE_SWITCH) target = switch_target(as_a<gswitch*>(last), s, index);
+
+    // the same as for a gcond the run can't decide
+    state other = s;
+    if(last && gimple_code(last) == GIMPLE_SWITCH && !target && index.from_input) forget_inputs(other);
+
+    edge e;
+    edge_iterator ei;
+    FOR_EACH_EDGE(e, ei, bb->succs) {
+        if(!target) hand_over(e->dest, other);
+        else if(e->dest == target) hand_over(e->dest, s);
+    }
+
+    if(!target || !index.from_input) return;
+
+    // the default case has no single term to flip to, it's only taken when
+    // other inputs happen to miss every label
+    gswitch* sw = as_a<gswitch*>(last);
+    for(unsigned int i = 1; i < gimple_switch_num_labels(sw); i++) {
+        tree label = gimple_switch_label(sw, i);
+        if(label_to_block(current_fn, CASE_LABEL(label)) == target) continue;
+
+        add_flip(s.pc, term(value(gimple_switch_index(sw)), EQ_EXPR, term::from_tree(CASE_LOW(label))));
+    }
+}
+
+// Run the function along the path its concrete inputs take, starting from
+// the entry block. Only blocks the run reaches are analyzed, in the order
+// it reaches them. When a branch can't be decided concretely, both sides are
+// queued, and a block reached more than once starts from the latest state.
+void run_concolic()
+{
+    std::unordered_map<basic_block, int> visits;
+
+    states.clear();
+    worklist.clear();
+    hand_over(single_succ(ENTRY_BLOCK_PTR_FOR_FN(current_fn)), state{});
+
+    for(int steps = 0; !worklist.empty() && steps < concolic_max_steps; steps++) {
+        basic_block bb = worklist.back();
+        worklist.pop_back();
+
+        if(++visits[bb] > concolic_max_visits) continue;
+
+        analyze_bb(bb);
+        sample_rss();
+    }
+}
+
+// Record the types of current_fn's parameters in input_params.
+void find_input_params()
+{
+    input_params.clear();
+
+    for(tree parm = DECL_ARGUMENTS(current_fn->decl); parm; parm = DECL_CHAIN(parm)) {
+        tree def = ssa_default_def(current_fn, parm);
+        if(def) input_params[SSA_NAME_VERSION(def)] = TREE_TYPE(def);
+    }
+}
+
+// Add the constants that v computes with or is compared against to out.
+void collect_constants(const value& v, std::set<concrete>& out)
+{
+    if(v.is_concrete()) out.insert(std::get<concrete>(v.content));
+
+    if(v.is_expr()) {
+        collect_constants(v.get_expr()->lhs, out);
+        collect_constants(v.get_expr()->rhs, out);
+    }
+}
+
+// Whether the inputs take the run down the path in f.pc, whose last term is
+// the flipped branch. That one has to be decided, the rest only must not fail.
+bool takes_flip(const flip& f, const std::map<unsigned int, concrete>& inputs)
+{
+    std::map<unsigned int, concrete> env = inputs;
+    if(f.pc.eval(env) == UNSATISFIABLE) return false;
+
+    bool holds;
+    return f.pc.ands.back().eval(env, holds) && holds;
+}
+
+// Look for inputs that take the branch in f the other way. This tries the
+// constants on the path, and one off either side of them, for one parameter
+// and then for pairs of them, so it can miss inputs that exist. Anything the
+// path doesn't decide is left as it was in the run that queued the flip.
+bool find_inputs(const flip& f, std::map<unsigned int, concrete>& model)
+{
+    std::set<concrete> constants = {concrete{0L}, concrete{1L}, concrete{-1L}};
+    for(const auto& t: f.pc.ands) {
+        collect_constants(t.lhs, constants);
+        collect_constants(t.rhs, constants);
+    }
+
+    // the values worth trying for each parameter
+    std::vector<std::pair<unsigned int, std::vector<concrete>>> candidates;
+
+    std::map<unsigned int, concrete> base = f.inputs;
+
+    for(const auto& [version, type]: input_params) {
+        bool floating = FLOAT_TYPE_P(type);
+        if(!floating && !INTEGRAL_TYPE_P(type)) continue;
+
+        if(floating) base.try_emplace(version, concrete{0.0});
+        else base.try_emplace(version, concrete{0L});
+
+        std::set<concrete> values;
+        for(const auto& c: constants) {
+            double d = std::visit([](auto v) { return (double) v; }, c);
+
+            if(floating) {
+                for(double delta: {0.0, -1.0, 1.0}) values.insert(concrete{d + delta});
+                continue;
+            }
+
+            unsigned long l = std::holds_alternative<long>(c) ? std::get<long>(c) : (long) d;
+            for(unsigned long delta: {0UL, -1UL, 1UL}) {
+                long wrapped;
+                if(wrap_to_type(l + delta, type, wrapped)) values.insert(concrete{wrapped});
+            }
+        }
+
+        candidates.emplace_back(version, std::vector<concrete>(values.begin(), values.end()));
+    }
+
+    int tries = 0;
+    model = base;
+
+    for(size_t i = 0; i < candidates.size(); i++) {
+        auto& [version, values] = candidates[i];
+
+        for(const auto& v: values) {
+            if(++tries > concolic_max_tries) return false;
+
+            model[version] = v;
+            if(takes_flip(f, model)) return true;
+        }
+
+        model[version] = base[version];
+    }
+
+    for(size_t i = 0; i < candidates.size(); i++) {
+        for(size_t j = i + 1; j < candidates.size(); j++) {
+            auto& [v1, values1] = candidates[i];
+            auto& [v2, values2] = candidates[j];
+
+            for(const auto& x: values1) {
+                for(const auto& y: values2) {
+                    if(++tries > concolic_max_tries) return false;
+
+                    model[v1] = x;
+                    model[v2] = y;
+                    if(takes_flip(f, model)) return true;
+                }
+            }
+
+            model[v1] = base[v1];
+            model[v2] = base[v2];
+        }
+    }
+
+    return false;
 }
 
-void analyze_fn()
+// find_inputs through the shared cache. Searches that come up empty are the
+// most expensive ones, so they're stored as UNKNOWN. A model from the cache is
+// checked against the path before it's used, since another function can have
+// a path with the same key.
+bool solve_flip(const flip& f, std::map<unsigned int, concrete>& model)
+{
+    uint64_t key = query_cache::key(f.pc);
+    cos_result verdict;
+    query_cache::model cached;
+
+    searches++;
+
+    if(shared_cache.lookup(key, verdict, &cached)) {
+        model = f.inputs;
+        for(const auto& [version, val]: cached) model[version] = val;
+
+        if(verdict == UNKNOWN || takes_flip(f, model)) {
+            cache_hits++;
+            return verdict != UNKNOWN;
+        }
+    }
+
+    bool found = find_inputs(f, model);
+
+    // the model has every parameter that the search could change
+    cached.clear();
+    if(found) {
+        for(const auto& pair: input_params) {
+            auto it = model.find(pair.first);
+            if(it != model.end()) cached.emplace_back(it->first, it->second);
+        }
+    }
+
+    if(!found || cached.size() <= query_cache::max_model) shared_cache.store(key, found ? SATISFIED : UNKNOWN, cached);
+    return found;
+}
+
+// Generational search: run the function with all-zero inputs, then again
+// with inputs that flip one of the input-dependent branches an earlier run
+// took, for as long as there are flips that inputs can be found for. Each
+// block ends up with the path conditions of every run that reached it.
+void analyze_concolic()
+{
+    std::unordered_map<basic_block, state> covered;
+    std::set<std::map<unsigned int, concrete>> tried;
+
+    find_input_params();
+    concolic_inputs.clear();
+    flipped.clear();
+
+    for(int run = 0; run < concolic_max_runs; run++) {
+        tried.insert(concolic_inputs);
+        run_concolic();
+
+        for(auto& pair: states) {
+            auto it = covered.find(pair.first);
+            if(it == covered.end()) covered.emplace(pair.first, std::move(pair.second));
+            else it->second.merge(pair.second);
+        }
+
+        // the latest flips first, they're the deepest
+        bool found = false;
+        while(!found && !pending_inputs.empty()) {
+            flip f = std::move(pending_inputs.back());
+            pending_inputs.pop_back();
+
+            std::map<unsigned int, concrete> inputs;
+            if(solve_flip(f, inputs) && !tried.count(inputs)) {
+                concolic_inputs = std::move(inputs);
+                found = true;
+            }
+        }
+
+        if(!found) break;
+    }
+
+    states = std::move(covered);
+}
+
+void analyze_fn(function* fn)
 {
     basic_block bb;
+
+    current_fn = fn;
+
+    // nothing carries over from the previous function, its blocks may be gone
+    states.clear();
+    pending_states.clear();
+    pending_inputs.clear();
+    searches = cache_hits = 0;
+
+    // only the engine's own work is measured, not GCC's or the dumping
+    auto start = std::chrono::steady_clock::now();
+    long rss_before = capture.to_file() ? current_rss_kb() : 0;
+    rss_peak_kb = rss_before;
+    rss_sampling_time = {};
+
+    find_irrelevant_guards();
     
-    FOR_EACH_BB_FN(bb, current_fn) {
+    if(concolic_mode) analyze_concolic();
+    else FOR_EACH_BB_FN(bb, current_fn) {
         analyze_bb(bb);
+        sample_rss();
     }
 
+    // how far above its starting point the analysis pushed the RSS
+    if(capture.to_file()) record_capture(std::chrono::steady_clock::now() - start - rss_sampling_time, rss_peak_kb - rss_before);
+
     for(const auto& pair: states) {
-        printf("<%p> %s\n", pair.first, pair.second.pc.str().c_str());
+        // lines from other processes and other functions of the same name
+        // end up in between, so every line has to stand on its own
+        state_dump.reset_ids();
+
+        if(state_dump.format == writer::JSON) {
+            state_dump.put("{\"fn\":").put_quoted(function_name(current_fn))
+                .put(",\"bb\":").put((long) pair.first->index).put(",\"pc\":");
+            pair.second.pc.write(state_dump);
+            state_dump.put("}\n");
+        }
+        else {
+            state_dump.put("<bb ").put((long) pair.first->index).put("> ");
+            pair.second.pc.write(state_dump);
+            state_dump.put('\n');
+        }
+
+        state_dump.flush();
     }
 
     if(!pending_states.empty()) {
@@ -6,6 +6,7 @@
 #ifndef SYMEXEC_COS_COS_H
 #define SYMEXEC_COS_COS_H
 
+#include <algorithm>
 #include <exception>
 #include <memory>
 #include <vector>
@@ -14,6 +15,12 @@
 #include <assert.h>
 #include <variant>
 #include <map>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+#include <cos/small-vector.h>
+#include <cos/writer.h>
 
 #include <gcc-plugin.h>
 #include <tree.h>
@@ -50,7 +57,7 @@ enum cos_result
 
 // The necessary layer of indirection to support proper mathematical expressions.
 struct expr;
-inline string expr_to_str(const expr*);
+inline void write_expr(writer&, const expr*);
 
 struct symbolic
 {
@@ -63,16 +70,122 @@ struct symbolic
         //assert(TREE_CODE(ssa) == SSA_NAME);
     }
 
-    symbolic(unsigned int v): version{v} {}
+    symbolic(unsigned int v): ssa_name{NULL_TREE}, version{v}, type{NULL_TREE} {}
 
     bool operator==(const symbolic& other) const { return version == other.version; }
     bool operator<(const symbolic& other) const { return version < other.version; }
 
-    string str() const { return "var_" + std::to_string(version); } // adjust this later
+    void write(writer& w) const
+    {
+        if(w.format == writer::JSON) w.put("{\"var\":").put(version).put('}');
+        else w.put("var_").put(version); // adjust this later
+    }
+
+    string str() const { string s; { writer w(s); write(w); } return s; }
 };
 
 using concrete = variant<long, double>;
 
+// Spread the bits of a hash around, so that summing and bit-picking work on it.
+inline size_t mix_hash(size_t h)
+{
+    uint64_t x = h + 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// Truncate x to the precision of the integral `type`, then sign or zero extend
+// it back, the way a value of that type wraps in the program. Types wider
+// than a long can't be represented.
+inline bool wrap_to_type(unsigned long x, tree type, long& out)
+{
+    unsigned int prec = TYPE_PRECISION(type);
+    if(prec > 64) return false;
+
+    if(prec < 64) {
+        x &= (1UL << prec) - 1;
+        if(!TYPE_UNSIGNED(type) && (x >> (prec - 1)) & 1) x |= ~0UL << prec;
+    }
+
+    out = (long) x;
+    return true;
+}
+
+// Concretely evaluate `a op b` as a value of `type`. Returns false if the
+// operation isn't supported.
+inline bool eval_binop(tree_code op, const concrete& a, const concrete& b, tree type, concrete& out)
+{
+    if(std::holds_alternative<long>(a) && std::holds_alternative<long>(b)) {
+        if(!INTEGRAL_TYPE_P(type) && !POINTER_TYPE_P(type)) return false;
+
+        unsigned long x = std::get<long>(a);
+        unsigned long y = std::get<long>(b);
+        unsigned long r;
+
+        switch(op) {
+            case PLUS_EXPR:  r = x + y; break;
+            case MINUS_EXPR: r = x - y; break;
+            case MULT_EXPR:  r = x * y; break;
+            default: return false;
+        }
+
+        long wrapped;
+        if(!wrap_to_type(r, type, wrapped)) return false;
+
+        out = wrapped;
+        return true;
+    }
+
+    double x = std::visit([](auto v) { return (double) v; }, a);
+    double y = std::visit([](auto v) { return (double) v; }, b);
+
+    switch(op) {
+        case PLUS_EXPR:  out = x + y; return true;
+        case MINUS_EXPR: out = x - y; return true;
+        case MULT_EXPR:  out = x * y; return true;
+        default: return false;
+    }
+}
+
+// Concretely decide the comparison `a op b`, with integers compared as unsigned
+// if is_unsigned is set. Returns false if op isn't a comparison.
+inline bool eval_cond(tree_code op, const concrete& a, const concrete& b, bool& out, bool is_unsigned = false)
+{
+    int cmp;
+
+    if(std::holds_alternative<long>(a) && std::holds_alternative<long>(b) && is_unsigned) {
+        unsigned long x = std::get<long>(a), y = std::get<long>(b);
+        cmp = (x > y) - (x < y);
+    }
+    else if(std::holds_alternative<long>(a) && std::holds_alternative<long>(b)) {
+        long x = std::get<long>(a), y = std::get<long>(b);
+        cmp = (x > y) - (x < y);
+    }
+    else {
+        double x = std::visit([](auto v) { return (double) v; }, a);
+        double y = std::visit([](auto v) { return (double) v; }, b);
+        cmp = (x > y) - (x < y);
+
+        // unordered, only != holds
+        if(x != x || y != y) {
+            out = op == NE_EXPR;
+            return op == LT_EXPR || op == LE_EXPR || op == GT_EXPR
+                || op == GE_EXPR || op == EQ_EXPR || op == NE_EXPR;
+        }
+    }
+
+    switch(op) {
+        case LT_EXPR: out = cmp < 0; return true;
+        case LE_EXPR: out = cmp <= 0; return true;
+        case GT_EXPR: out = cmp > 0; return true;
+        case GE_EXPR: out = cmp >= 0; return true;
+        case EQ_EXPR: out = cmp == 0; return true;
+        case NE_EXPR: out = cmp != 0; return true;
+        default: return false;
+    }
+}
+
 struct value
 {
     variant<concrete, symbolic, expr*> content;
@@ -84,6 +197,9 @@ struct value
     value(tree ssa): content{symbolic{ssa}} {}
     value(expr* e): content{e} {}
     value(const value& other) = default;
+    value(value&& other) = default;
+    value& operator=(const value& other) = default;
+    value& operator=(value&& other) = default;
 
     bool is_concrete() const { return std::holds_alternative<concrete>(content); }
     bool is_symbolic() const { return std::holds_alternative<symbolic>(content); }
@@ -125,9 +241,29 @@ struct value
             return std::get<symbolic>(content) == std::get<symbolic>(other.content);
         }
 
+        // exprs aren't interned, process_arithmetic allocates a new one for
+        // every statement, so this only holds for copies of the same term
+        if(is_expr() && other.is_expr()) {
+            return std::get<expr*>(content) == std::get<expr*>(other.content);
+        }
+
         return false;
     }
 
+    // Consistent with operator==.
+    size_t hash() const
+    {
+        size_t h = std::visit(overloaded{
+            [](const concrete& c) {
+                return std::visit([](auto arg) { return std::hash<decltype(arg)>{}(arg); }, c);
+            },
+            [](const symbolic& s) { return (size_t) s.version; },
+            [](const expr* e) { return std::hash<const expr*>{}(e); }
+        }, content);
+
+        return mix_hash(h + content.index());
+    }
+
     bool operator<(const value& other) const
     {
         if(is_concrete() && other.is_concrete()) {
@@ -147,23 +283,23 @@ struct value
     bool operator>=(const value& other) const { return !(*this < other); }
     bool operator!=(const value& other) const { return !(other == *this); }
 
-    string str() const
+    void write(writer& w) const
     {
-        return std::visit(overloaded{
-            [](const concrete& c) -> string {
-                return std::visit([](auto&& arg) {
-                    return std::to_string(arg);
-                }, c);
+        std::visit(overloaded{
+            [&](const concrete& c) {
+                std::visit([&](auto arg) { w.put(arg); }, c);
             },
-            [](const symbolic& s) -> string {
-                return s.str();
+            [&](const symbolic& s) {
+                s.write(w);
             },
-            [](const expr* e) -> string {
-                return expr_to_str(e);
+            [&](const expr* e) {
+                write_expr(w, e);
             }
         }, content);
     }
 
+    string str() const { string s; { writer w(s); write(w); } return s; }
+
     template<class... stuff> struct overloaded: stuff... { using stuff::operator()...; };
     template<class... stuff> overloaded(stuff...) -> overloaded<stuff...>;
 
@@ -188,15 +324,69 @@ struct expr
         return e;
     }
 
-    string str() const
+    // With w.share_exprs set, the first occurrence is printed as #id=(...)
+    // in the human format or {"id":id,...} in JSON, and later ones as just
+    // #id or {"ref":id}.
+    void write(writer& w) const
     {
-        return "(" + lhs.str() + " " + op_to_str(op) + " " + rhs.str() + ")";
+        unsigned int id = 0;
+
+        if(w.share_exprs && w.node_id(this, id)) {
+            if(w.format == writer::JSON) w.put("{\"ref\":").put(id).put('}');
+            else w.put('#').put(id);
+            return;
+        }
+
+        if(w.format == writer::JSON) {
+            w.put('{');
+            if(id) w.put("\"id\":").put(id).put(',');
+            w.put("\"op\":\"").put(op_to_str(op)).put("\",\"lhs\":");
+            lhs.write(w);
+            w.put(",\"rhs\":");
+            rhs.write(w);
+            w.put('}');
+            return;
+        }
+
+        if(id) w.put('#').put(id).put('=');
+        w.put('(');
+        lhs.write(w);
+        w.put(' ').put(op_to_str(op)).put(' ');
+        rhs.write(w);
+        w.put(')');
     }
 
+    string str() const { string s; { writer w(s); write(w); } return s; }
+
     ~expr() { delete this; }
 };
 
-inline string expr_to_str(const expr* e) { return e->str(); }
+inline void write_expr(writer& w, const expr* e) { e->write(w); }
+
+// The concrete value of v when each symbol has the value its version maps to
+// in env. Exprs are computed as values of `type`. Returns false if a symbol
+// has no value or the expr can't be computed.
+inline bool eval_value(const value& v, const std::map<unsigned int, concrete>& env, tree type, concrete& out)
+{
+    if(v.is_concrete()) {
+        out = std::get<concrete>(v.content);
+        return true;
+    }
+
+    if(v.is_symbolic()) {
+        auto it = env.find(v.get_symbolic().version);
+        if(it == env.end()) return false;
+
+        out = it->second;
+        return true;
+    }
+
+    const expr* e = v.get_expr();
+    concrete a, b;
+
+    return type && eval_value(e->lhs, env, type, a) && eval_value(e->rhs, env, type, b)
+        && eval_binop(e->op, a, b, type, out);
+}
 
 struct term
 {
@@ -207,6 +397,9 @@ struct term
     term(const value& l, tree_code o, const value& r): lhs{l}, op{o}, rhs{r} {}
     
     term(const term& t) = default;
+    term(term&& t) = default;
+    term& operator=(const term& original) = default;
+    term& operator=(term&& original) = default;
 
     term(tree cond):
     lhs{from_tree(TREE_OPERAND(cond, 0))},
@@ -217,15 +410,6 @@ struct term
             || op == LE_EXPR || op == GT_EXPR || op == GE_EXPR);
     }
 
-    term& operator=(const term& original)
-    {
-        lhs = original.lhs;
-        op = original.op;
-        rhs = original.rhs;
-
-        return *this;
-    }
-
     static value from_tree(tree t)
     {
         switch(TREE_CODE(t)) {
@@ -237,6 +421,68 @@ struct term
         }
     }
 
+    // The same comparison with > and >= turned around, and the operands of
+    // == and != ordered, so that equivalent terms compare and hash equal.
+    term canonical() const
+    {
+        const value* l;
+        const value* r;
+        tree_code o = canonical_op(l, r);
+
+        return term(*l, o, *r);
+    }
+
+    // The op of canonical(), with l and r pointed at its operands, for when
+    // the term itself isn't needed.
+    tree_code canonical_op(const value*& l, const value*& r) const
+    {
+        l = &lhs;
+        r = &rhs;
+
+        switch(op) {
+            case GT_EXPR: std::swap(l, r); return LT_EXPR;
+            case GE_EXPR: std::swap(l, r); return LE_EXPR;
+            case EQ_EXPR:
+            case NE_EXPR:
+                if(rhs.hash() < lhs.hash()) std::swap(l, r);
+                return op;
+            default: return op;
+        }
+    }
+
+    bool operator==(const term& other) const
+    {
+        const value *l1, *r1, *l2, *r2;
+        return canonical_op(l1, r1) == other.canonical_op(l2, r2) && *l1 == *l2 && *r1 == *r2;
+    }
+
+    size_t hash() const
+    {
+        size_t l = lhs.hash(), r = rhs.hash();
+        tree_code o = op;
+
+        if(op == GT_EXPR || op == GE_EXPR) {
+            std::swap(l, r);
+            o = op == GT_EXPR ? LT_EXPR : LE_EXPR;
+        }
+        else if((op == EQ_EXPR || op == NE_EXPR) && r < l) std::swap(l, r);
+
+        return mix_hash(l ^ mix_hash(r + o));
+    }
+
+    // Decide the comparison when the symbols have the values in env. Returns
+    // false if it can't be decided.
+    bool eval(const std::map<unsigned int, concrete>& env, bool& holds) const
+    {
+        concrete a, b;
+        if(!eval_value(lhs, env, NULL_TREE, a) || !eval_value(rhs, env, NULL_TREE, b)) return false;
+
+        tree type = lhs.is_symbolic() ? lhs.get_symbolic().type
+            : rhs.is_symbolic() ? rhs.get_symbolic().type : NULL_TREE;
+
+        return eval_cond(op, a, b, holds, type && TYPE_UNSIGNED(type));
+    }
+
     term operator!()
     {
         term negated = {*this};
@@ -254,63 +500,192 @@ struct term
         return negated;
     }
     
-    string str() const 
-    { 
-        std::string s = "(" + lhs.str() + " "
-                        + op_to_str(op) + " " 
-                        + rhs.str();
-        s += ")";
+    void write(writer& w) const
+    {
+        if(w.format == writer::JSON) {
+            w.put("{\"op\":\"").put(op_to_str(op)).put("\",\"lhs\":");
+            lhs.write(w);
+            w.put(",\"rhs\":");
+            rhs.write(w);
+            w.put('}');
+            return;
+        }
 
-        return s;
+        w.put('(');
+        lhs.write(w);
+        w.put(' ').put(op_to_str(op)).put(' ');
+        rhs.write(w);
+        w.put(')');
     }
 
+    string str() const { string s; { writer w(s); write(w); } return s; }
+
     ~term() = default;
 };
 
 struct inner
 {
-    vector<term> ands;
+    // Most conjunctions are short enough to never touch the heap.
+    small_vector<term, 12> ands;
     bool unsatisfiable = false;
 
+    // The sum of the term hashes, which doesn't depend on their order.
+    size_t fingerprint = 0;
+
+    // One bit per term, picked by its hash. A term can only be in ands
+    // if its bit is set.
+    uint64_t bits = 0;
+
+    // The hash of every term and where it is in ands, sorted by hash, so
+    // that looking a term up is a binary search.
+    small_vector<std::pair<size_t, unsigned int>, 12> hashes;
+
     inner(): ands{} {}
-    inner(const inner& original): ands{original.ands}, 
-        unsatisfiable{original.unsatisfiable} {}
+    inner(const inner& original) = default;
+    inner(inner&& original) = default;
+    inner& operator=(const inner& original) = default;
+    inner& operator=(inner&& original) = default;
+
+    static uint64_t term_bit(size_t hash) { return 1ull << (hash >> 58); }
 
-    inner& operator=(const inner& original)
+    // The first entry of hashes that isn't below hash.
+    size_t lower_bound(size_t hash) const
     {
-        ands = original.ands;
-        unsatisfiable = original.unsatisfiable;
-        return *this;
+        auto it = std::lower_bound(hashes.begin(), hashes.end(), hash,
+            [](const std::pair<size_t, unsigned int>& entry, size_t h) { return entry.first < h; });
+        return it - hashes.begin();
     }
 
-    string str() const
+    // Whether t is among the terms with the given hash, starting from the
+    // entry i of hashes.
+    bool contains_from(const term& t, size_t hash, size_t i) const
     {
-        string s = "[";
-        
+        for(; i < hashes.size() && hashes[i].first == hash; i++) {
+            if(ands[hashes[i].second] == t) return true;
+        }
+
+        return false;
+    }
+
+    bool contains(const term& t, size_t hash) const
+    {
+        if(!(bits & term_bit(hash))) return false;
+
+        return contains_from(t, hash, lower_bound(hash));
+    }
+
+    bool contains(const term& t) const { return contains(t, t.hash()); }
+
+    // Whether every term of this is also in other, which makes other redundant
+    // next to this in a disjunction.
+    bool subsumes(const inner& other) const
+    {
+        if(other.unsatisfiable) return true;
+        if(unsatisfiable) return false;
+
+        if(ands.size() > other.ands.size() || (bits & ~other.bits)) return false;
+
+        // same terms, the common case for paths that reconverge
+        if(ands.size() == other.ands.size() && fingerprint != other.fingerprint) return false;
+
+        // both are sorted by hash, so one pass over each is enough
+        size_t j = 0;
+
+        for(const auto& [hash, i]: hashes) {
+            while(j < other.hashes.size() && other.hashes[j].first < hash) j++;
+            if(!other.contains_from(ands[i], hash, j)) return false;
+        }
+
+        return true;
+    }
+
+    // JSON: an array of terms, or "unsatisfiable".
+    void write(writer& w) const
+    {
+        bool json = w.format == writer::JSON;
+
         if(ands.empty()) {
-            s += "empty]";
-            return s;
+            w.put(json ? "[]" : "[empty]");
+            return;
         }
         if(unsatisfiable) {
-            s += "unsatisfiable]";
-            return s;
+            w.put(json ? "\"unsatisfiable\"" : "[unsatisfiable]");
+            return;
         }
 
-        for(int i = 0; i < ands.size() - 1; i++) {
-            s += ands[i].str();
-            s += " AND ";
+        w.put('[');
+        for(size_t i = 0; i < ands.size(); i++) {
+            if(i) w.put(json ? "," : " AND ");
+            ands[i].write(w);
         }
-        s += ands.back().str();
-        s += "]";
-        
-        return s;
+        w.put(']');
     }
 
-    void add_constraint(term& t)
+    string str() const { string s; { writer w(s); write(w); } return s; }
+
+    // Returns false if t was already there.
+    bool add_constraint(term& t)
     {
-        if(unsatisfiable) return;
+        if(unsatisfiable) return true;
+
+        size_t hash = t.hash();
+        size_t i = lower_bound(hash);
+        if((bits & term_bit(hash)) && contains_from(t, hash, i)) return false;
 
+        hashes.insert(i, {hash, (unsigned int) ands.size()});
         ands.push_back(t);
+        fingerprint += hash;
+        bits |= term_bit(hash);
+
+        return true;
+    }
+
+    // Decide the terms that compare two concrete values. Anything involving
+    // symbols is left for the solver, so this only ever proves unsatisfiability
+    // or satisfies fully ground conjunctions.
+    cos_result check() const
+    {
+        if(unsatisfiable) return UNSATISFIABLE;
+
+        bool ground = true;
+        for(const auto& t: ands) {
+            bool holds;
+
+            if(!t.lhs.is_concrete() || !t.rhs.is_concrete()
+            || !eval_cond(t.op, std::get<concrete>(t.lhs.content), std::get<concrete>(t.rhs.content), holds)) {
+                ground = false;
+                continue;
+            }
+
+            if(!holds) return UNSATISFIABLE;
+        }
+
+        return ground ? SATISFIED : UNKNOWN;
+    }
+
+    // Check the conjunction when the symbols have the values in env. The
+    // engine adds terms in program order, so a == whose lhs has no value yet
+    // is its definition, and binds it in env instead of being checked.
+    cos_result eval(std::map<unsigned int, concrete>& env) const
+    {
+        if(unsatisfiable) return UNSATISFIABLE;
+
+        cos_result res = SATISFIED;
+
+        for(const auto& t: ands) {
+            if(t.op == EQ_EXPR && t.lhs.is_symbolic() && !env.count(t.lhs.get_symbolic().version)) {
+                concrete c;
+                if(eval_value(t.rhs, env, t.lhs.get_symbolic().type, c)) env[t.lhs.get_symbolic().version] = c;
+                else res = UNKNOWN;
+                continue;
+            }
+
+            bool holds;
+            if(!t.eval(env, holds)) res = UNKNOWN;
+            else if(!holds) return UNSATISFIABLE;
+        }
+
+        return res;
     }
 
     void simplify();
@@ -322,62 +697,177 @@ struct outer
 {
     vector<inner> ors;
 
-    outer(): ors{1} {};
-    outer(const outer& original): ors{original.ors} {}
+    outer(): ors{1} {}
+    outer(const outer& original) = default;
+    outer(outer&& original) = default;
+    outer& operator=(const outer& original) = default;
+    outer& operator=(outer&& original) = default;
+
+    // Where each disjunct is in ors, by fingerprint. Only built for merges,
+    // where it finds exact duplicates without looking at the other disjuncts.
+    using fingerprint_index = std::unordered_multimap<size_t, size_t>;
+
+    fingerprint_index index() const
+    {
+        fingerprint_index idx;
+
+        for(size_t i = 0; i < ors.size(); i++) {
+            idx.emplace(ors[i].fingerprint, i);
+        }
+
+        return idx;
+    }
+
+    bool has_duplicate(const inner& in, const fingerprint_index& idx) const
+    {
+        auto [it, end] = idx.equal_range(in.fingerprint);
+
+        for(; it != end; ++it) {
+            const inner& other = ors[it->second];
+            if(other.unsatisfiable == in.unsatisfiable && other.ands.size() == in.ands.size()
+            && other.subsumes(in)) return true;
+        }
 
-    outer& operator=(const outer& original) 
-    { 
-        ors = original.ors;
-        return *this;
+        return false;
     }
 
     void add_constraint(term& t)
     {
-        for(auto& inner: ors) {
-            inner.add_constraint(t);
+        // 1 for the disjuncts that already had t
+        small_vector<char, 16> flags;
+        bool any = false;
+
+        for(size_t i = 0; i < ors.size(); i++) {
+            bool had = !ors[i].add_constraint(t);
+            flags.push_back(had);
+            any |= had;
+        }
+
+        // No disjunct subsumed another before, and adding t to both sides of
+        // a pair keeps it that way. Only one that already had t can now
+        // subsume, or equal, one that just got it.
+        if(!any || ors.size() < 2) return;
+
+        constexpr char had = 1, drop = 2;
+
+        for(size_t i = 0; i < ors.size(); i++) {
+            if(flags[i] != had) continue;
+
+            for(size_t j = 0; j < ors.size(); j++) {
+                if(!flags[j] && ors[i].subsumes(ors[j])) flags[j] = drop;
+            }
+        }
+
+        size_t i = 0;
+        std::erase_if(ors, [&](const inner&) { return flags[i++] == drop; });
+    }
+
+    // Add the disjunct unless one that subsumes it is already there, and drop
+    // the ones it subsumes. idx has to be up to date with ors, and is kept so.
+    void add_disjunct(const inner& in, fingerprint_index& idx)
+    {
+        // the common case, paths that reconverge under the same conditions
+        if(has_duplicate(in, idx)) return;
+
+        for(const auto& existing: ors) {
+            if(existing.subsumes(in)) return;
         }
+
+        size_t count = ors.size();
+        std::erase_if(ors, [&](const inner& existing) { return in.subsumes(existing); });
+        ors.push_back(in);
+
+        if(ors.size() == count + 1) idx.emplace(in.fingerprint, ors.size() - 1);
+        else idx = index();
+    }
+
+    void add_disjunct(const inner& in)
+    {
+        fingerprint_index idx = index();
+        add_disjunct(in, idx);
     }
 
     void merge(const outer& other)
     {
-        ors.insert(ors.end(), other.ors.begin(), other.ors.end());
+        ors.reserve(ors.size() + other.ors.size());
+        fingerprint_index idx = index();
+
+        for(const auto& in: other.ors) {
+            add_disjunct(in, idx);
+        }
     }
 
-    string str() const
+    // One satisfiable disjunct is enough, all of them have to fail for UNSATISFIABLE.
+    cos_result check() const
     {
-        string s = "";
+        cos_result res = UNSATISFIABLE;
 
-        if(ors.empty()) {
-            s += "(empty)";
-            return s;
+        for(const auto& inner: ors) {
+            cos_result r = inner.check();
+            if(r == SATISFIED) return SATISFIED;
+            if(r == UNKNOWN) res = UNKNOWN;
         }
-        
-        for(int i = 0; i < ors.size() - 1; i++) {
-            s += ors[i].str();
-            s += " OR ";
+
+        return res;
+    }
+
+    // JSON: an array of disjuncts.
+    void write(writer& w) const
+    {
+        bool json = w.format == writer::JSON;
+
+        if(ors.empty()) {
+            w.put(json ? "[]" : "(empty)");
+            return;
         }
-        s += ors.back().str();
 
-        return s;
+        if(json) w.put('[');
+        for(size_t i = 0; i < ors.size(); i++) {
+            if(i) w.put(json ? "," : " OR ");
+            ors[i].write(w);
+        }
+        if(json) w.put(']');
     }
 
+    string str() const { string s; { writer w(s); write(w); } return s; }
+
     ~outer() = default;
 };
 
+// A concrete value used in concolic mode, along with whether it was computed
+// from the function's inputs. Values that aren't can never change between runs.
+// A value that depends on the inputs but couldn't be computed isn't known, but
+// is still kept around, since branching on it says something about the inputs.
+struct concolic_value
+{
+    concrete val;
+    bool from_input = false;
+    bool known = true;
+};
+
 // The path condition for a basic block, stored in DNF form
 struct state
 {
     outer pc;
-    basic_block* bb;
+    basic_block* bb = nullptr;
+
+    // The concrete assignment that goes alongside pc in concolic mode.
+    std::map<symbolic, concolic_value> env;
 
     state(): pc{} {};
-    state(const state& original): pc{original.pc} {}
-    state& operator=(const state& original) { pc = original.pc; return *this; }
+    state(const state& original) = default;
+    state(state&& original) = default;
+    state& operator=(const state& original) = default;
+    state& operator=(state&& original) = default;
 
     string str()
     {
         string s = "<state> ";
-        s += pc.str() + "\n";
+        {
+            writer w(s);
+            pc.write(w);
+            w.put('\n');
+        }
         return s;
     }
 
@@ -385,10 +875,7 @@ struct state
     void add_constraint(tree cond)
     {
         term new_term = term(cond);
-
-        for(auto& inner: pc.ors) {
-            inner.add_constraint(new_term);
-        }
+        pc.add_constraint(new_term);
     }
 
     // Add the given term as a constraint to this state.
@@ -404,11 +891,7 @@ struct state
 
     void merge(state& s)
     {
-        pc.ors.reserve(pc.ors.size() + s.pc.ors.size());
-        
-        for(auto& inner: s.pc.ors) {
-            pc.ors.push_back(inner);
-        }
+        pc.merge(s.pc);
     }
 
     ~state() = default;
@@ -0,0 +1,285 @@
+/*  A cache of query results shared between compiler processes.
+
+    Copyright (C) 2025 Ivan Klikovac
+    This program is free software. */
+
+#ifndef SYMEXEC_COS_QUERYCACHE_H
+#define SYMEXEC_COS_QUERYCACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cos/cos.h>
+
+// The cache is a memory-mapped file holding a fixed number of slots, so its
+// size is capped when it's created. Each query hashes to a short run of slots,
+// and when all of them are taken the least recently used one is evicted.
+//
+// Slots are guarded by a sequence number that is odd while a process writes
+// to the slot. Nobody ever waits: readers treat a slot that changed under
+// them as a miss, and writers give up on a slot that someone else is already
+// writing. A process killed halfway through a store leaves its slot odd, so
+// a slot that has been odd for long enough is taken over by the next writer.
+struct query_cache
+{
+    static constexpr unsigned int max_model = 8;
+    static constexpr unsigned int probe_len = 8;
+    static constexpr uint64_t magic = 0x31656863736f63; // "cosche1"
+
+    // How many cache operations a slot can stay locked before its writer is
+    // assumed dead. A live one holds it for a handful of stores.
+    static constexpr uint64_t stale_after = 1 << 20;
+
+    using model = vector<std::pair<unsigned int, concrete>>;
+
+    struct model_entry
+    {
+        uint32_t version;
+        uint32_t is_floating;
+        uint64_t bits;
+    };
+
+    struct slot
+    {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> key; // 0 if empty
+        std::atomic<uint64_t> stamp; // last use, for eviction
+        uint32_t verdict;
+        uint32_t model_size;
+        model_entry model[max_model];
+    };
+
+    struct header
+    {
+        uint64_t magic;
+        uint64_t slot_count;
+        std::atomic<uint64_t> clock;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the cache needs address-free atomics");
+
+    header* head = nullptr;
+    slot* slots = nullptr;
+    size_t mapped = 0;
+
+    query_cache() = default;
+    query_cache(const query_cache&) = delete;
+    query_cache& operator=(const query_cache&) = delete;
+
+    bool is_open() const { return head; }
+
+    // Open the cache at path, creating it with room for slot_count entries if
+    // it doesn't exist. An existing cache keeps its own size.
+    bool open(const char* path, size_t slot_count)
+    {
+        close();
+
+        if(!slot_count) return false;
+
+        int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if(fd < 0) return false;
+
+        // only held while the file is created and sized, never for lookups
+        flock(fd, LOCK_EX);
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        size_t size = st.st_size;
+
+        // new, or too small to ever have been usable, start over
+        if(ok && size < sizeof(header) + sizeof(slot)) {
+            size = sizeof(header) + slot_count * sizeof(slot);
+            ok = ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0;
+        }
+
+        void* p = MAP_FAILED;
+        if(ok) p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if(p != MAP_FAILED) {
+            head = (header*) p;
+            slots = (slot*) (head + 1);
+            mapped = size;
+
+            if(!head->magic) {
+                head->slot_count = (size - sizeof(header)) / sizeof(slot);
+                head->magic = magic;
+            }
+
+            if(head->magic != magic || !head->slot_count
+            || sizeof(header) + head->slot_count * sizeof(slot) > size) close();
+        }
+
+        flock(fd, LOCK_UN);
+        ::close(fd);
+
+        return is_open();
+    }
+
+    void close()
+    {
+        if(head) munmap(head, mapped);
+
+        head = nullptr;
+        slots = nullptr;
+        mapped = 0;
+    }
+
+    // The key of a conjunction. Unlike inner::fingerprint, this doesn't depend
+    // on where exprs happen to be allocated, so it's the same in every process.
+    static uint64_t key(const inner& in)
+    {
+        uint64_t k = mix_hash(in.ands.size() + in.unsatisfiable);
+
+        for(const auto& t: in.ands) {
+            k += term_hash(t);
+        }
+
+        return k ? k : 1;
+    }
+
+    // Canonicalized like term::canonical, but with == and != ordered by the
+    // stable hash instead of one that involves pointers.
+    static uint64_t term_hash(const term& t)
+    {
+        uint64_t l = stable_hash(t.lhs), r = stable_hash(t.rhs);
+        tree_code op = t.op;
+
+        if(op == GT_EXPR || op == GE_EXPR) {
+            std::swap(l, r);
+            op = op == GT_EXPR ? LT_EXPR : LE_EXPR;
+        }
+        else if((op == EQ_EXPR || op == NE_EXPR) && r < l) std::swap(l, r);
+
+        return mix_hash(l ^ mix_hash(r + op));
+    }
+
+    static uint64_t stable_hash(const value& v)
+    {
+        // the same comparison means something else for a narrower or
+        // unsigned type
+        if(v.is_symbolic()) {
+            tree type = v.get_symbolic().type;
+            if(!type) return v.hash();
+
+            uint64_t t = TYPE_PRECISION(type) | TYPE_UNSIGNED(type) << 16 | FLOAT_TYPE_P(type) << 17;
+            return mix_hash(v.hash() ^ mix_hash(t));
+        }
+
+        if(!v.is_expr()) return v.hash();
+
+        const expr* e = v.get_expr();
+        return mix_hash(stable_hash(e->lhs) ^ mix_hash(stable_hash(e->rhs) + e->op) + v.content.index());
+    }
+
+    // Fill in the verdict, and the model if m isn't null, for the given key.
+    bool lookup(uint64_t k, cos_result& verdict, model* m = nullptr)
+    {
+        if(!head) return false;
+
+        for(unsigned int i = 0; i < probe_len; i++) {
+            slot& s = slots[(k + i) % head->slot_count];
+
+            uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if(seq & 1 || s.key.load(std::memory_order_relaxed) != k) continue;
+
+            uint32_t v = s.verdict;
+            uint32_t n = std::min(s.model_size, max_model);
+            model_entry entries[max_model];
+            memcpy(entries, s.model, n * sizeof(model_entry));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(s.seq.load(std::memory_order_relaxed) != seq) return false;
+
+            verdict = (cos_result) v;
+
+            if(m) {
+                m->clear();
+                for(uint32_t j = 0; j < n; j++) {
+                    if(entries[j].is_floating) {
+                        double d;
+                        memcpy(&d, &entries[j].bits, sizeof(d));
+                        m->emplace_back(entries[j].version, concrete{d});
+                    }
+                    else m->emplace_back(entries[j].version, concrete{(long) entries[j].bits});
+                }
+            }
+
+            s.stamp.store(head->clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Store the verdict for the given key. Models that don't fit are dropped,
+    // so that a hit never returns a partial one.
+    void store(uint64_t k, cos_result verdict, const model& m = {})
+    {
+        if(!head) return;
+
+        // reuse the key's slot or an empty one, or else evict the oldest
+        slot* victim = nullptr;
+
+        for(unsigned int i = 0; i < probe_len; i++) {
+            slot& s = slots[(k + i) % head->slot_count];
+            uint64_t key = s.key.load(std::memory_order_relaxed);
+
+            if(key == k || key == 0) {
+                victim = &s;
+                break;
+            }
+
+            if(!victim || s.stamp.load(std::memory_order_relaxed) < victim->stamp.load(std::memory_order_relaxed))
+                victim = &s;
+        }
+
+        // the odd value of seq while the slot is ours
+        uint64_t seq = victim->seq.load(std::memory_order_relaxed);
+        uint64_t locked = seq + 1;
+
+        if(seq & 1) {
+            uint64_t age = head->clock.load(std::memory_order_relaxed) - victim->stamp.load(std::memory_order_relaxed);
+            if(age < stale_after) return;
+
+            // its writer died, stay odd while taking it over
+            locked = seq + 2;
+        }
+
+        if(!victim->seq.compare_exchange_strong(seq, locked, std::memory_order_acquire)) return;
+
+        // a reader that sees any of the new data has to see seq odd as well
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // stamped before writing, so that a slot left locked ages
+        victim->stamp.store(head->clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+
+        victim->key.store(k, std::memory_order_relaxed);
+        victim->verdict = verdict;
+        victim->model_size = m.size() <= max_model ? m.size() : 0;
+
+        for(uint32_t j = 0; j < victim->model_size; j++) {
+            model_entry& entry = victim->model[j];
+            entry.version = m[j].first;
+            entry.is_floating = std::holds_alternative<double>(m[j].second);
+
+            if(entry.is_floating) memcpy(&entry.bits, &std::get<double>(m[j].second), sizeof(double));
+            else entry.bits = std::get<long>(m[j].second);
+        }
+
+        victim->seq.store(locked + 1, std::memory_order_release);
+    }
+
+    ~query_cache() { close(); }
+};
+
+#endif
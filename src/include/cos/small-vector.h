@@ -0,0 +1,160 @@
+/*  A vector that keeps its first few elements inline.
+
+    Copyright (C) 2025 Ivan Klikovac
+    This program is free software. */
+
+#ifndef SYMEXEC_COS_SMALLVECTOR_H
+#define SYMEXEC_COS_SMALLVECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <assert.h>
+
+// Up to N elements live inside the object itself, so short sequences cost no
+// heap allocation to build, copy or move. Past that, everything moves to the
+// heap like in a std::vector.
+template<typename T, size_t N>
+struct small_vector
+{
+    small_vector() = default;
+
+    small_vector(const small_vector& other)
+    {
+        reserve(other.count);
+        std::uninitialized_copy(other.begin(), other.end(), data());
+        count = other.count;
+    }
+
+    small_vector(small_vector&& other) noexcept { steal(other); }
+
+    small_vector& operator=(const small_vector& other)
+    {
+        if(this == &other) return *this;
+
+        clear();
+        reserve(other.count);
+        std::uninitialized_copy(other.begin(), other.end(), data());
+        count = other.count;
+
+        return *this;
+    }
+
+    small_vector& operator=(small_vector&& other) noexcept
+    {
+        if(this == &other) return *this;
+
+        clear();
+        release();
+        steal(other);
+
+        return *this;
+    }
+
+    T* data() { return heap ? heap : reinterpret_cast<T*>(storage); }
+    const T* data() const { return heap ? heap : reinterpret_cast<const T*>(storage); }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return !count; }
+
+    T* begin() { return data(); }
+    T* end() { return data() + count; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+
+    T& operator[](size_t i) { assert(i < count && "small_vector[]"); return data()[i]; }
+    const T& operator[](size_t i) const { assert(i < count && "small_vector[]"); return data()[i]; }
+
+    T& back() { assert(count && "small_vector.back"); return data()[count - 1]; }
+    const T& back() const { assert(count && "small_vector.back"); return data()[count - 1]; }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if(count == cap) {
+            // args could refer to an element that's about to move
+            T tmp(std::forward<Args>(args)...);
+            reserve(cap * 2);
+            return *new(data() + count++) T(std::move(tmp));
+        }
+
+        return *new(data() + count++) T(std::forward<Args>(args)...);
+    }
+
+    void push_back(const T& t) { emplace_back(t); }
+    void push_back(T&& t) { emplace_back(std::move(t)); }
+
+    // Insert t before the element at index i.
+    void insert(size_t i, T t)
+    {
+        assert(i <= count && "small_vector.insert");
+
+        emplace_back(std::move(t));
+        std::rotate(begin() + i, end() - 1, end());
+    }
+
+    void reserve(size_t n)
+    {
+        if(n <= cap) return;
+
+        T* fresh = static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        std::uninitialized_move(begin(), end(), fresh);
+        std::destroy(begin(), end());
+        release();
+
+        heap = fresh;
+        cap = n;
+    }
+
+    void clear()
+    {
+        std::destroy(begin(), end());
+        count = 0;
+    }
+
+    ~small_vector()
+    {
+        clear();
+        release();
+    }
+
+private:
+    alignas(T) unsigned char storage[N * sizeof(T)];
+    T* heap = nullptr;
+    size_t count = 0;
+    size_t cap = N;
+
+    // Free the heap buffer and go back to the inline one. Expects no elements.
+    void release()
+    {
+        if(heap) ::operator delete(heap, std::align_val_t{alignof(T)});
+
+        heap = nullptr;
+        cap = N;
+    }
+
+    // Take over the elements of other, which is left empty.
+    void steal(small_vector& other)
+    {
+        if(other.heap) {
+            heap = other.heap;
+            cap = other.cap;
+            count = other.count;
+
+            other.heap = nullptr;
+            other.cap = N;
+            other.count = 0;
+            return;
+        }
+
+        std::uninitialized_move(other.begin(), other.end(), data());
+        count = other.count;
+        other.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,170 @@
+/*  A buffered output sink that cos structures stream into.
+
+    Copyright (C) 2025 Ivan Klikovac
+    This program is free software. */
+
+#ifndef SYMEXEC_COS_WRITER_H
+#define SYMEXEC_COS_WRITER_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include <unistd.h>
+
+// Everything is appended to a buffer, so dumping a deep expression is linear
+// in its size instead of building a temporary string at every level.
+//
+// A writer either appends straight into a string, or hands its buffer to a
+// file descriptor with a single write(2) on every flush. Flushing only at the
+// end of a record means that records from several processes appending to the
+// same O_APPEND file never get split or interleaved.
+struct writer
+{
+    enum format_t
+    {
+        HUMAN,
+        JSON
+    };
+
+    format_t format = HUMAN;
+
+    // Print every expr node once and refer to it by ID afterwards, until
+    // reset_ids is called.
+    bool share_exprs = false;
+
+    // Descriptors other than stdin, stdout and stderr belong to the writer.
+    writer(int f, format_t fmt = HUMAN, bool share = false):
+        format{fmt}, share_exprs{share}, fd{f} {}
+    writer(std::string& s): buf{&s} {}
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    // Flush and redirect to another file descriptor.
+    void reset(int f, format_t fmt)
+    {
+        flush();
+        close_fd();
+
+        fd = f;
+        buf = &own;
+        format = fmt;
+        ids.clear();
+    }
+
+    bool to_file() const { return fd >= 0; }
+
+    writer& put(const char* s, size_t n)
+    {
+        buf->append(s, n);
+        return *this;
+    }
+
+    writer& put(const char* s) { return put(s, strlen(s)); }
+    writer& put(const std::string& s) { return put(s.data(), s.size()); }
+
+    writer& put(char c)
+    {
+        buf->push_back(c);
+        return *this;
+    }
+
+    // A JSON string, quotes included.
+    writer& put_quoted(const char* s)
+    {
+        put('"');
+        for(; *s; s++) {
+            if(*s == '"' || *s == '\\') put('\\');
+            if((unsigned char) *s < 0x20) {
+                char tmp[8];
+                put(tmp, snprintf(tmp, sizeof(tmp), "\\u%04x", *s));
+            }
+            else put(*s);
+        }
+        return put('"');
+    }
+
+    writer& put(long l)
+    {
+        char tmp[24];
+        return put(tmp, snprintf(tmp, sizeof(tmp), "%ld", l));
+    }
+
+    writer& put(unsigned int u)
+    {
+        char tmp[16];
+        return put(tmp, snprintf(tmp, sizeof(tmp), "%u", u));
+    }
+
+    writer& put(double d)
+    {
+        char tmp[32];
+
+        // JSON has no representation for nan or inf
+        if(format == JSON && (d != d || d - d != 0)) return put("null");
+
+        // the human format keeps what std::to_string used to print
+        return put(tmp, snprintf(tmp, sizeof(tmp), format == JSON ? "%.17g" : "%f", d));
+    }
+
+    // Look up the ID of a shared node. Returns true if it was printed before,
+    // otherwise a new ID is assigned.
+    bool node_id(const void* node, unsigned int& id)
+    {
+        auto [it, inserted] = ids.try_emplace(node, ids.size() + 1);
+        id = it->second;
+        return !inserted;
+    }
+
+    // Forget the printed nodes, IDs start from 1 again.
+    void reset_ids() { ids.clear(); }
+
+    // Write out everything since the last flush. Call this at the end of a
+    // record, never in the middle of one.
+    void flush()
+    {
+        if(fd < 0 || own.empty()) return;
+
+        // keep the order of anything printf'd before
+        if(fd == STDOUT_FILENO) fflush(stdout);
+
+        const char* p = own.data();
+        size_t left = own.size();
+
+        while(left) {
+            ssize_t n = write(fd, p, left);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+
+            p += n;
+            left -= n;
+        }
+
+        own.clear();
+    }
+
+    ~writer()
+    {
+        flush();
+        close_fd();
+    }
+
+private:
+    std::string own;
+    std::string* buf = &own;
+
+    int fd = -1;
+
+    std::unordered_map<const void*, unsigned int> ids;
+
+    void close_fd()
+    {
+        if(fd > STDERR_FILENO) close(fd);
+        fd = -1;
+    }
+};
+
+#endif
@@ -6,8 +6,23 @@
 #ifndef SYMEXEC_ENGINE_H
 #define SYMEXEC_ENGINE_H
 
+#include <cstddef>
+
 struct function;
 
-void analyze_fn(function* fn);
+// Run the engine on fn. GCC's cfun has to be fn as well.
+extern "C" void analyze_fn(function* fn);
+
+// Follow concretely decided branches instead of forking on them.
+extern "C" bool concolic_mode;
+
+// Dump states into the file at path (stdout if null), as JSON lines if json is set.
+extern "C" void set_dump(const char* path, bool json);
+
+// Share query results with other processes through the cache file at path.
+extern "C" void set_query_cache(const char* path, size_t slots);
+
+// Record per-function measurements into the file at path, for symexec-bench.
+extern "C" void set_capture(const char* path);
 
 #endif
@@ -14,6 +14,8 @@
     along with this program. If not, see <https://www.gnu.org/licenses/>. */
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unordered_map>
 #include <string>
 
@@ -33,6 +35,10 @@ extern "C" {
 
 int plugin_is_GPL_compatible = 3;
 
+// The engine only runs when one of its arguments is given, otherwise the
+// plugin just lists the functions it sees.
+bool engine_enabled = false;
+
 const pass_data data = {
     GIMPLE_PASS,
     "test_pass",
@@ -51,7 +57,7 @@ struct test_pass: gimple_opt_pass
     unsigned int execute(function* fn) override
     {
         printf("function %s\n", function_name(fn));
-        //analyze_fn(fn);
+        if(engine_enabled) analyze_fn(fn);
 
         return 0;
     }
@@ -66,6 +72,32 @@ int plugin_init(struct plugin_name_args* plugin_info, struct plugin_gcc_version*
 
     printf("loading %s...\n", plugin_info->base_name);
 
+    const char* dump_path = nullptr;
+    bool dump_json = false;
+    const char* cache_path = nullptr;
+    size_t cache_slots = 1 << 16;
+
+    // -fplugin-arg-symexec-<key>[=<value>]
+    for(int i = 0; i < plugin_info->argc; i++) {
+        const plugin_argument& arg = plugin_info->argv[i];
+
+        if(!strcmp(arg.key, "concolic")) concolic_mode = true;
+        else if(!strcmp(arg.key, "dump")) dump_path = arg.value;
+        else if(!strcmp(arg.key, "dump-format")) dump_json = arg.value && !strcmp(arg.value, "json");
+        else if(!strcmp(arg.key, "cache")) cache_path = arg.value;
+        else if(!strcmp(arg.key, "capture") && arg.value) set_capture(arg.value);
+        else if(!strcmp(arg.key, "cache-size") && arg.value) cache_slots = strtoul(arg.value, nullptr, 10);
+        else {
+            printf("unknown argument %s\n", arg.key);
+            continue;
+        }
+
+        engine_enabled = true;
+    }
+
+    if(dump_path || dump_json) set_dump(dump_path, dump_json);
+    if(cache_path) set_query_cache(cache_path, cache_slots);
+
     register_pass_info info;
     info.pass = new test_pass(g);
     info.reference_pass_name = "optimized";
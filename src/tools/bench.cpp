@@ -0,0 +1,177 @@
+/*  symexec-bench: compare the captures the plugin records against a baseline.
+
+    Copyright (C) 2025 Ivan Klikovac
+    This program is free software. */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+using std::string;
+
+// The measurements of one function. When a function was captured more than
+// once, the best time is kept and the rest come from the same run.
+struct capture
+{
+    string hash;
+    long time_us = -1;
+    long peak_rss_kb = 0;
+    long states = 0;
+    long pending = 0;
+    long disjuncts = 0;
+    long terms = 0;
+};
+
+// The plugin writes flat JSON objects, one per line, with string or integer
+// values, so that's all this has to read.
+bool parse_line(const char* p, std::map<string, string>& fields)
+{
+    fields.clear();
+
+    auto read_string = [&](string& out) {
+        if(*p++ != '"') return false;
+        for(; *p && *p != '"'; p++) {
+            if(*p == '\\' && p[1]) p++;
+            out += *p;
+        }
+        return *p++ == '"';
+    };
+
+    if(*p++ != '{') return false;
+
+    while(*p && *p != '}') {
+        string key, val;
+        if(!read_string(key) || *p++ != ':') return false;
+
+        if(*p == '"') {
+            if(!read_string(val)) return false;
+        }
+        else {
+            while(*p && *p != ',' && *p != '}') val += *p++;
+        }
+
+        fields[key] = val;
+        if(*p == ',') p++;
+    }
+
+    return *p == '}';
+}
+
+bool load(const char* path, std::map<string, capture>& captures)
+{
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    char* line = nullptr;
+    size_t cap = 0;
+    std::map<string, string> fields;
+
+    while(getline(&line, &cap, f) > 0) {
+        if(!parse_line(line, fields) || !fields.count("fn")) continue;
+
+        capture c;
+        c.hash = fields["hash"];
+        c.time_us = atol(fields["time_us"].c_str());
+        c.peak_rss_kb = atol(fields["peak_rss_kb"].c_str());
+        c.states = atol(fields["states"].c_str());
+        c.pending = atol(fields["pending"].c_str());
+        c.disjuncts = atol(fields["disjuncts"].c_str());
+        c.terms = atol(fields["terms"].c_str());
+
+        // functions from different translation units can share a name
+        string key = fields["fn"] + "@" + c.hash;
+
+        auto it = captures.find(key);
+        if(it == captures.end() || c.time_us < it->second.time_us) captures[key] = c;
+    }
+
+    free(line);
+    fclose(f);
+    return true;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: symexec-bench <capture> [baseline] [--threshold=<percent>] [--min-time=<us>]\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* current_path = nullptr;
+    const char* baseline_path = nullptr;
+    double threshold = 10;
+    long min_time = 100;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strncmp(argv[i], "--threshold=", 12)) threshold = atof(argv[i] + 12);
+        else if(!strncmp(argv[i], "--min-time=", 11)) min_time = atol(argv[i] + 11);
+        else if(!current_path) current_path = argv[i];
+        else if(!baseline_path) baseline_path = argv[i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    if(!current_path) {
+        usage();
+        return 2;
+    }
+
+    std::map<string, capture> current, baseline;
+    if(!load(current_path, current)) return 2;
+    if(baseline_path && !load(baseline_path, baseline)) return 2;
+
+    printf("%-40s %10s %10s %8s %8s %10s %10s %10s\n",
+        "function", "time_us", "base_us", "change", "states", "disjuncts", "terms", "peak_kb");
+
+    long total = 0, base_total = 0;
+    double log_ratio_sum = 0;
+    int compared = 0, regressions = 0;
+
+    for(const auto& [key, c]: current) {
+        string name = key.substr(0, key.rfind('@'));
+        total += c.time_us;
+
+        auto it = baseline.find(key);
+        if(it == baseline.end()) {
+            printf("%-40s %10ld %10s %8s %8ld %10ld %10ld %10ld\n", name.c_str(), c.time_us,
+                "-", "-", c.states, c.disjuncts, c.terms, c.peak_rss_kb);
+            continue;
+        }
+
+        const capture& b = it->second;
+        base_total += b.time_us;
+
+        double change = b.time_us ? 100.0 * (c.time_us - b.time_us) / b.time_us : 0;
+
+        // very short functions are mostly noise
+        bool regressed = change > threshold && std::max(c.time_us, b.time_us) >= min_time;
+        if(regressed) regressions++;
+
+        if(b.time_us > 0 && c.time_us > 0) {
+            log_ratio_sum += std::log((double) c.time_us / b.time_us);
+            compared++;
+        }
+
+        printf("%-40s %10ld %10ld %+7.1f%% %8ld %10ld %10ld %10ld%s\n", name.c_str(), c.time_us,
+            b.time_us, change, c.states, c.disjuncts, c.terms, c.peak_rss_kb, regressed ? "  REGRESSED" : "");
+    }
+
+    printf("\n%zu functions, %ld us total\n", current.size(), total);
+
+    if(baseline_path) {
+        printf("%d compared against the baseline (%ld us), geometric mean ratio %.3f\n",
+            compared, base_total, compared ? std::exp(log_ratio_sum / compared) : 1.0);
+        printf("%d regressed by more than %.1f%%\n", regressions, threshold);
+    }
+
+    return regressions ? 1 : 0;
+}